@@ -2,17 +2,21 @@
 #define _DEFAULT_SOURCE ////If you define this macro, most features are included apart from X/Open, LFS and GNU extensions: the effect is to enable features from the 2008 edition of POSIX, as well as certain BSD and SVID features without a separate feature test macro to control them.
 #define _BSD_SOURCE
 #define _GNU_SOURCE //If you define this macro, everything is included: ISO C89, ISO C99, POSIX.1, POSIX.2, BSD, SVID, X/Open, LFS, and GNU extensions. In the cases where POSIX.1 conflicts with BSD, the POSIX definitions take precedence.
+#define _FILE_OFFSET_BITS 64  //64bit off_t even on 32bit systems so huge files can be mapped and seeked
 
 /*** includes ***/
 
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>     //INT_MAX
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>     //atexit()
 #include <string.h>     //memcpy()
 #include <sys/ioctl.h>  //to get size of terminal with TIOCGWINSZ
+#include <sys/mman.h>   //mmap() for hex view
+#include <sys/stat.h>   //fstat() to get file size
 #include <sys/types.h>
 #include <termios.h>    //terminal settings
 #include <time.h>
@@ -24,6 +28,9 @@
 #define KETHU_VERSION "0.0.1"
 #define KETHU_TAB_STOP 8
 #define KILO_QUIT_TIMES 3
+#define HEX_LINE_BYTES 16   //bytes shown per line in hex view
+#define HEX_SNIFF_LEN 8192  //bytes checked for NUL to decide if file is binary
+#define HEX_PAT_MAX 64      //longest byte pattern that can be searched for
 
 #define CTRL_KEY(k) ((k) & 0x1f)    //bitwise ANDs char with 0x1f(00011111)
                                     //upper 3bits of character made 0, mirroring what ctrl key does in terminal, it strips bit 5 and 6 from whatever key pressed in combo with ctrl and sends that.
@@ -50,6 +57,38 @@ typedef struct erow {
   char *render;
 } erow;
 
+typedef struct bnode {  //summary of a range of rows in the structure index
+  int net;      //opening minus closing brackets in the range
+  int min;      //lowest bracket depth reached in the range, relative to depth at its start(so always <= 0)
+  int indent;   //smallest indentation of a non blank row in the range, INT_MAX if all blank
+} bnode;
+
+typedef struct efold {  //rows start..end (inclusive) are hidden, row start-1 is shown as the fold header
+  int start;
+  int end;
+} efold;
+
+typedef struct hpatch { //one edited byte in hex view, kept in array sorted by off
+  off_t off;
+  unsigned char byte;
+} hpatch;
+
+typedef struct hexview {  //state of hex view, active only when map != NULL
+  unsigned char *map; //whole file mapped read-only, pages are only loaded when touched
+  off_t size;         //size of file in bytes
+  int fd;
+  int readonly;       //file could not be opened for writing
+  int force;          //-x on command line, open in hex view even if file looks like text
+  int offwidth;       //number of hex digits used for offset column
+  off_t cur;          //byte offset of cursor
+  int nibble;         //0 = high nibble of byte under cursor, 1 = low nibble
+  off_t rowoff;       //first line(of HEX_LINE_BYTES bytes) shown on screen
+  hpatch *patch;      //sparse overlay of edits not yet written to file
+  int numpatches;
+  unsigned char pat[HEX_PAT_MAX]; //last searched pattern, for find next
+  int patlen;
+} hexview;
+
 struct editorConfig { //to store editor state
   int cx, cy;         //store position of cursor
   int rx;             //position of cursor on the render field
@@ -59,11 +98,16 @@ struct editorConfig { //to store editor state
   int screencols;     //number of cols visible in terminal
   int numrows;        //number of rows in file opened
   erow *row;          //struct to store each row in file
+  bnode *tree;        //segment tree over rows, leaf for row i at tree[treecap + i], root at tree[1]
+  int treecap;        //number of leaves, power of 2 >= numrows
+  efold *fold;        //folded ranges, sorted and not overlapping
+  int numfolds;
   int dirty;
   char *filename;
   char statusmsg[80];
   time_t statusmsg_time;
   struct termios orig_termios;
+  hexview hex;
 };
 struct editorConfig E;
 
@@ -73,6 +117,7 @@ struct editorConfig E;
 void editorSetStatusMessage(const char *fmt, ...);
 void editorRefreshScreen();
 char *editorPrompt(char *prompt);
+int hexOpen(char *filename);
 
 /*** terminal ***/
 
@@ -184,6 +229,218 @@ int getWindowSize(int *rows, int *cols) {
 }
 
 
+/*** structure index ***/
+
+int isOpenBracket(int c) {
+  return c == '(' || c == '[' || c == '{';
+}
+
+int isCloseBracket(int c) {
+  return c == ')' || c == ']' || c == '}';
+}
+
+int editorRowNextBracket(erow *row, int j) {  //index of next bracket at or after j that is not in a string or comment, -1 if none
+  while (j < row->size) {                     //j must be 0 or just after a bracket returned before, so we never start inside a string
+    char c = row->chars[j];
+    if (c == '"' || c == '\'') {  //skip string or char literal, escapes included
+      j++;
+      while (j < row->size && row->chars[j] != c) {
+        if (row->chars[j] == '\\') j++;
+        j++;
+      }
+      j++;
+      continue;
+    }
+    if (c == '/' && j + 1 < row->size && row->chars[j + 1] == '/') return -1;  //rest of row is a comment
+    if (c == '/' && j + 1 < row->size && row->chars[j + 1] == '*') {
+      char *end = strstr(&row->chars[j + 2], "*/");
+      if (end == NULL) return -1;  //comment runs past this row
+      j = end - row->chars + 2;
+      continue;
+    }
+    if (isOpenBracket(c) || isCloseBracket(c)) return j;
+    j++;
+  }
+  return -1;
+}
+
+void bracketPull(int node) {  //recompute node from its two children
+  bnode *l = &E.tree[node * 2];
+  bnode *r = &E.tree[node * 2 + 1];
+  E.tree[node].net = l->net + r->net;
+  E.tree[node].min = l->min < l->net + r->min ? l->min : l->net + r->min;
+  E.tree[node].indent = l->indent < r->indent ? l->indent : r->indent;
+}
+
+void bracketRebuild(int lo, int hi) {  //recompute every node above leaves lo..hi, O(hi - lo + log n)
+  lo += E.treecap;
+  hi += E.treecap;
+  while (lo > 1) {
+    lo >>= 1;
+    hi >>= 1;
+    int i;
+    for (i = lo; i <= hi; i++) bracketPull(i);
+  }
+}
+
+void bracketClearLeaf(int at) {
+  E.tree[E.treecap + at].net = 0;
+  E.tree[E.treecap + at].min = 0;
+  E.tree[E.treecap + at].indent = INT_MAX;
+}
+
+void bracketUpdateRow(int at) {  //resummarise one row and fix the path to the root
+  erow *row = &E.row[at];
+  bnode *leaf = &E.tree[E.treecap + at];
+  leaf->net = 0;
+  leaf->min = 0;
+  int j = -1;
+  while ((j = editorRowNextBracket(row, j + 1)) != -1) {
+    leaf->net += isOpenBracket(row->chars[j]) ? 1 : -1;
+    if (leaf->net < leaf->min) leaf->min = leaf->net;
+  }
+  int indent = 0;
+  for (j = 0; j < row->size && (row->chars[j] == ' ' || row->chars[j] == '\t'); j++)
+    indent += (row->chars[j] == '\t') ? KETHU_TAB_STOP - indent % KETHU_TAB_STOP : 1;
+  leaf->indent = (j == row->size) ? INT_MAX : indent;  //blank rows never end an indented block
+
+  int node = (E.treecap + at) >> 1;
+  while (node >= 1) {
+    bracketPull(node);
+    node >>= 1;
+  }
+}
+
+void bracketInsertRow(int at) {  //make room for a new row at 'at', leaves move like E.row does
+  if (E.numrows + 1 > E.treecap) {  //double leaves and build whole tree again, amortised O(1) per row on file load
+    int newcap = E.treecap ? E.treecap * 2 : 64;
+    bnode *tree = malloc(sizeof(bnode) * newcap * 2);
+    if (E.numrows) memcpy(&tree[newcap], &E.tree[E.treecap], sizeof(bnode) * E.numrows);
+    free(E.tree);
+    E.tree = tree;
+    E.treecap = newcap;
+    int i;
+    for (i = E.numrows; i < newcap; i++) bracketClearLeaf(i);
+    bracketRebuild(0, newcap - 1);
+  }
+  memmove(&E.tree[E.treecap + at + 1], &E.tree[E.treecap + at], sizeof(bnode) * (E.numrows - at));
+  bracketClearLeaf(at);  //filled in by editorUpdateRow()
+  bracketRebuild(at, E.numrows);
+}
+
+void bracketDelRow(int at) {
+  memmove(&E.tree[E.treecap + at], &E.tree[E.treecap + at + 1], sizeof(bnode) * (E.numrows - at - 1));
+  bracketClearLeaf(E.numrows - 1);
+  bracketRebuild(at, E.numrows - 1);
+}
+
+int bracketDepthAt(int at) {  //bracket depth at start of row 'at', sum of net over rows before it
+  if (at >= E.treecap) return E.treecap ? E.tree[1].net : 0;
+  int node = 1, l = 0, r = E.treecap, depth = 0;
+  while (r - l > 1) {
+    int mid = (l + r) / 2;
+    if (at >= mid) {
+      depth += E.tree[node * 2].net;
+      node = node * 2 + 1;
+      l = mid;
+    } else {
+      node = node * 2;
+      r = mid;
+    }
+  }
+  return depth;
+}
+
+int bracketFirst(int node, int l, int r, int depth, int from, int target) {  //first row >= from whose depth drops to <= target, -1 if none. depth is depth at start of row l
+  if (r <= from || l >= E.numrows || depth + E.tree[node].min > target) return -1;
+  if (r - l == 1) return l;
+  int mid = (l + r) / 2;
+  int found = bracketFirst(node * 2, l, mid, depth, from, target);
+  if (found != -1) return found;
+  return bracketFirst(node * 2 + 1, mid, r, depth + E.tree[node * 2].net, from, target);
+}
+
+int bracketLast(int node, int l, int r, int depth, int to, int target) {  //last row <= to whose depth drops to <= target, -1 if none
+  if (l > to || l >= E.numrows || depth + E.tree[node].min > target) return -1;
+  if (r - l == 1) return l;
+  int mid = (l + r) / 2;
+  int found = bracketLast(node * 2 + 1, mid, r, depth + E.tree[node * 2].net, to, target);
+  if (found != -1) return found;
+  return bracketLast(node * 2, l, mid, depth, to, target);
+}
+
+int indentFirst(int node, int l, int r, int from, int limit) {  //first row >= from indented at most limit columns, -1 if none
+  if (r <= from || l >= E.numrows || E.tree[node].indent > limit) return -1;
+  if (r - l == 1) return l;
+  int mid = (l + r) / 2;
+  int found = indentFirst(node * 2, l, mid, from, limit);
+  if (found != -1) return found;
+  return indentFirst(node * 2 + 1, mid, r, from, limit);
+}
+
+int editorFoldAt(int row) {  //binary search, index of fold hiding row or -1
+  int lo = 0, hi = E.numfolds;
+  while (lo < hi) {  //first fold that starts after row
+    int mid = lo + (hi - lo) / 2;
+    if (E.fold[mid].start <= row) lo = mid + 1;
+    else hi = mid;
+  }
+  if (lo > 0 && E.fold[lo - 1].end >= row) return lo - 1;
+  return -1;
+}
+
+void editorDelFold(int f) {
+  memmove(&E.fold[f], &E.fold[f + 1], sizeof(efold) * (E.numfolds - f - 1));
+  E.numfolds--;
+}
+
+void editorShiftFolds(int at, int delta) {  //keep folds on the same rows after a row is inserted(+1) or deleted(-1) at 'at'
+  int f = E.numfolds;
+  while (f-- > 0) {
+    if (delta < 0 && E.fold[f].start == at + 1) {  //header row deleted, nothing left to show the fold on
+      editorDelFold(f);
+    } else if (E.fold[f].start > at || (delta > 0 && E.fold[f].start == at)) {
+      E.fold[f].start += delta;
+      E.fold[f].end += delta;
+    } else if (E.fold[f].end >= at) {  //row changed inside a fold, open it up
+      editorDelFold(f);
+    } else {
+      break;  //sorted, nothing before this is affected
+    }
+  }
+}
+
+int editorNextVisibleRow(int row) {  //jumps over folds in one step each, hidden rows are never walked
+  int f;
+  row++;
+  while ((f = editorFoldAt(row)) != -1) row = E.fold[f].end + 1;
+  return row;
+}
+
+int editorPrevVisibleRow(int row) {
+  int f;
+  row--;
+  while (row >= 0 && (f = editorFoldAt(row)) != -1) row = E.fold[f].start - 1;
+  return row;
+}
+
+int editorScreenRowsBetween(int from, int to) {  //visible rows from 'from' up to 'to', both visible and from <= to
+  int hidden = 0;
+  int f = editorFoldAt(from);
+  if (f == -1) {  //first fold after 'from'
+    int lo = 0, hi = E.numfolds;
+    while (lo < hi) {
+      int mid = lo + (hi - lo) / 2;
+      if (E.fold[mid].start <= from) lo = mid + 1;
+      else hi = mid;
+    }
+    f = lo;
+  }
+  for (; f < E.numfolds && E.fold[f].end < to; f++)
+    hidden += E.fold[f].end - E.fold[f].start + 1;
+  return to - from - hidden;
+}
+
 /*** row operations ***/
 
 int editorRowCxToRx(erow *row, int cx) {  //converts chars index into render index
@@ -217,12 +474,15 @@ void editorUpdateRow(erow *row) { //cleanup the tabs
   } //idx now is the size of characters in render. Suppose idx=11, we allocated +1 space so total length = 12
   row->render[idx] = '\0';  //make 11 index as null character to signal end
   row->rsize = idx; //does not include '\0'??
+  bracketUpdateRow(row - E.row);  //every row edit ends up here, so index stays in step with the text
 }
 
 void editorInsertRow(int at, char *s, size_t len) {
   if (at < 0 || at > E.numrows) return;
   E.row = realloc(E.row, sizeof(erow) * (E.numrows + 1));
   memmove(&E.row[at + 1], &E.row[at], sizeof(erow) * (E.numrows - at));
+  bracketInsertRow(at);
+  editorShiftFolds(at, 1);
 
   E.row[at].size = len;
   E.row[at].chars = malloc(len + 1);
@@ -244,6 +504,8 @@ void editorDelRow(int at) { //replace freed up row with rows below it
   if (at < 0 || at >= E.numrows) return;
   editorFreeRow(&E.row[at]);
   memmove(&E.row[at], &E.row[at + 1], sizeof(erow) * (E.numrows - at - 1)); //move all rows that comes after deleted row to 'at'
+  bracketDelRow(at);
+  editorShiftFolds(at, -1);
   E.numrows--;
   E.dirty++;
 }
@@ -303,6 +565,8 @@ void editorInsertNewline() {
 void editorDelChar() {
   if (E.cy == E.numrows) return;
   if (E.cx == 0 && E.cy == 0) return;
+  if (E.cx == 0 && editorFoldAt(E.cy - 1) != -1)  //joining onto a hidden row, show it first
+    editorDelFold(editorFoldAt(E.cy - 1));
   erow *row = &E.row[E.cy];
   if (E.cx > 0) {
     editorRowDelChar(row, E.cx - 1);
@@ -315,6 +579,114 @@ void editorDelChar() {
   }
 }
 
+void editorMatchBracket() {  //jump to bracket matching the one at or after cursor on this row, O(log n + row length)
+  if (E.cy >= E.numrows) return;
+  erow *row = &E.row[E.cy];
+  int depth = bracketDepthAt(E.cy);
+  int j = editorRowNextBracket(row, 0);
+  while (j != -1 && j < E.cx) {  //depth just before the bracket we match
+    depth += isOpenBracket(row->chars[j]) ? 1 : -1;
+    j = editorRowNextBracket(row, j + 1);
+  }
+  if (j == -1) {
+    editorSetStatusMessage("No bracket at cursor");
+    return;
+  }
+
+  int open = isOpenBracket(row->chars[j]);
+  int target = open ? depth : depth - 1;  //opener: match is first closer taking depth back to where it was. closer: last opener starting at depth - 1
+  int mrow = -1, mcol = -1;
+  if (open) {
+    int d = depth + 1, k = j;
+    while ((k = editorRowNextBracket(row, k + 1)) != -1) {
+      d += isOpenBracket(row->chars[k]) ? 1 : -1;
+      if (d == target) break;
+    }
+    if (k != -1) {
+      mrow = E.cy;
+      mcol = k;
+    } else {
+      mrow = bracketFirst(1, 0, E.treecap, 0, E.cy + 1, target);
+    }
+  } else {
+    int d = bracketDepthAt(E.cy), k = -1;
+    while ((k = editorRowNextBracket(row, k + 1)) != -1 && k < j) {
+      if (isOpenBracket(row->chars[k]) && d == target) mcol = k;
+      d += isOpenBracket(row->chars[k]) ? 1 : -1;
+    }
+    if (mcol != -1) mrow = E.cy;
+    else if (E.cy > 0) mrow = bracketLast(1, 0, E.treecap, 0, E.cy - 1, target);
+  }
+  if (mrow == -1) {
+    editorSetStatusMessage("No matching bracket");
+    return;
+  }
+
+  if (mcol == -1) {  //index only gives the row, find column inside it
+    erow *mr = &E.row[mrow];
+    int d = bracketDepthAt(mrow), k = -1;
+    while ((k = editorRowNextBracket(mr, k + 1)) != -1) {
+      int isopen = isOpenBracket(mr->chars[k]);
+      if (open && !isopen && d - 1 == target) {  //first closer that gets back to target
+        mcol = k;
+        break;
+      }
+      if (!open && isopen && d == target) mcol = k;  //last opener that starts at target
+      d += isopen ? 1 : -1;
+    }
+  }
+
+  int f = editorFoldAt(mrow);
+  if (f != -1) editorDelFold(f);  //never leave cursor on a hidden row
+  char a = row->chars[j], b = E.row[mrow].chars[mcol];
+  char pair = open ? (a == '(' ? ')' : a + 2) : (a == ')' ? '(' : a - 2);  //'[' ']' and '{' '}' are 2 apart in ASCII
+  if (b != pair) editorSetStatusMessage("Mismatched bracket %c", b);
+  E.cy = mrow;
+  E.cx = mcol;
+}
+
+int editorFoldEnd(int at) {  //last row of block opened by row 'at', -1 if it opens none
+  bnode *leaf = &E.tree[E.treecap + at];
+  int end;
+  if (leaf->net > leaf->min) {  //row leaves a bracket open, block ends on row where depth drops below its end depth
+    int depth = bracketDepthAt(at) + leaf->net;
+    end = bracketFirst(1, 0, E.treecap, 0, at + 1, depth - 1);
+    end = (end == -1) ? E.numrows - 1 : end - 1;  //closing row stays visible
+  } else {  //no bracket, fall back to indentation
+    int next = indentFirst(1, 0, E.treecap, at + 1, INT_MAX - 1);  //next non blank row
+    if (leaf->indent == INT_MAX || next == -1 || E.tree[E.treecap + next].indent <= leaf->indent) return -1;
+    end = indentFirst(1, 0, E.treecap, next, leaf->indent);
+    end = (end == -1) ? E.numrows - 1 : end - 1;
+    while (end > at && E.tree[E.treecap + end].indent == INT_MAX) end--;  //trailing blank rows stay visible
+  }
+  return end > at ? end : -1;
+}
+
+void editorToggleFold() {
+  if (E.cy >= E.numrows) return;
+  int f = editorFoldAt(E.cy + 1);
+  if (f != -1 && E.fold[f].start == E.cy + 1) {
+    editorDelFold(f);
+    return;
+  }
+
+  int end = editorFoldEnd(E.cy);
+  if (end == -1) {
+    editorSetStatusMessage("Nothing to fold");
+    return;
+  }
+  int lo = 0;
+  while (lo < E.numfolds && E.fold[lo].start <= E.cy) lo++;
+  int hi = lo;
+  while (hi < E.numfolds && E.fold[hi].start <= end) hi++;  //folds inside the new one are swallowed by it
+  if (hi > lo && E.fold[hi - 1].end > end) end = E.fold[hi - 1].end;
+  E.fold = realloc(E.fold, sizeof(efold) * (E.numfolds + 1));
+  memmove(&E.fold[lo + 1], &E.fold[hi], sizeof(efold) * (E.numfolds - hi));
+  E.fold[lo].start = E.cy + 1;
+  E.fold[lo].end = end;
+  E.numfolds += 1 - (hi - lo);
+}
+
 /*** file i/o ***/
 
 char *editorRowsToString(int *buflen) {
@@ -337,6 +709,7 @@ char *editorRowsToString(int *buflen) {
 void editorOpen(char *filename) {
   free(E.filename);
   E.filename = strdup(filename);  //makes copy of given string, also allocates required mem but has to be free() after use
+  if (hexOpen(filename)) return;  //binary files go to hex view and are never split into rows
 
   FILE *fp = fopen(filename, "r");
   if (!fp) die("fopen");
@@ -401,6 +774,382 @@ void abFree(struct abuf *ab) {      //Destructor
   free(ab->b);
 }
 
+/*** hex view ***/
+
+char hexpairs[512];   //"000102...feff", two digit form of every byte so a line is formatted with one copy per byte
+
+int hexOpen(char *filename) {  //map file and switch to hex view if it is binary, returns 0 to fall back to text editing
+  int readonly = 0;
+  int fd = open(filename, O_RDWR);
+  if (fd == -1) {
+    fd = open(filename, O_RDONLY);
+    readonly = 1;
+  }
+  if (fd == -1) return 0;   //let editorOpen() report the error
+
+  struct stat st;
+  if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0) {  //mmap() of empty file fails, nothing to view anyway
+    close(fd);
+    return 0;
+  }
+  unsigned char *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);  //no bytes are read here, kernel pages them in as lines get drawn
+  if (map == MAP_FAILED) {
+    close(fd);
+    return 0;
+  }
+  size_t sniff = st.st_size < HEX_SNIFF_LEN ? st.st_size : HEX_SNIFF_LEN;
+  if (!E.hex.force && memchr(map, '\0', sniff) == NULL) {  //no NUL in first few KB, treat as text
+    munmap(map, st.st_size);
+    close(fd);
+    return 0;
+  }
+
+  int j;
+  for (j = 0; j < 256; j++) {
+    hexpairs[j * 2] = "0123456789abcdef"[j >> 4];
+    hexpairs[j * 2 + 1] = "0123456789abcdef"[j & 0x0f];
+  }
+
+  E.hex.map = map;
+  E.hex.size = st.st_size;
+  E.hex.fd = fd;
+  E.hex.readonly = readonly;
+  E.hex.offwidth = 8;
+  while (E.hex.offwidth < 16 && ((st.st_size - 1) >> (E.hex.offwidth * 4)) != 0)  //enough digits for the last offset
+    E.hex.offwidth++;
+  E.hex.cur = 0;
+  E.hex.nibble = 0;
+  E.hex.rowoff = 0;
+  E.dirty = 0;
+  return 1;
+}
+
+int hexFindPatch(off_t off) {  //binary search, index of first patch at or after off
+  int lo = 0, hi = E.hex.numpatches;
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if (E.hex.patch[mid].off < off) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+unsigned char hexByteAt(off_t off) {  //byte as the user sees it, edits laid over the file
+  int i = hexFindPatch(off);
+  if (i < E.hex.numpatches && E.hex.patch[i].off == off) return E.hex.patch[i].byte;
+  return E.hex.map[off];
+}
+
+void hexSetByte(off_t off, unsigned char b) {
+  int i = hexFindPatch(off);
+  int found = i < E.hex.numpatches && E.hex.patch[i].off == off;
+  if (b == E.hex.map[off]) {  //same as on disk, drop the edit so overlay only holds real changes
+    if (found) {
+      memmove(&E.hex.patch[i], &E.hex.patch[i + 1], sizeof(hpatch) * (E.hex.numpatches - i - 1));
+      E.hex.numpatches--;
+      E.dirty = E.hex.numpatches != 0;  //every edit undone, nothing left to save
+    }
+  } else if (found) {
+    if (E.hex.patch[i].byte != b) E.dirty++;
+    E.hex.patch[i].byte = b;
+  } else {
+    E.hex.patch = realloc(E.hex.patch, sizeof(hpatch) * (E.hex.numpatches + 1));
+    memmove(&E.hex.patch[i + 1], &E.hex.patch[i], sizeof(hpatch) * (E.hex.numpatches - i));
+    E.hex.patch[i].off = off;
+    E.hex.patch[i].byte = b;
+    E.hex.numpatches++;
+    E.dirty++;
+  }
+}
+
+int hexFormatLine(off_t line, char *out) {  //writes "offset  xx xx ... |ascii|" for one line into out, returns its length
+  off_t start = line * HEX_LINE_BYTES;
+  int n = E.hex.size - start < HEX_LINE_BYTES ? E.hex.size - start : HEX_LINE_BYTES;
+  unsigned char bytes[HEX_LINE_BYTES];
+  memcpy(bytes, &E.hex.map[start], n);  //copy line out of map once, then lay edits over it
+  int i = hexFindPatch(start);
+  while (i < E.hex.numpatches && E.hex.patch[i].off < start + n) {
+    bytes[E.hex.patch[i].off - start] = E.hex.patch[i].byte;
+    i++;
+  }
+
+  char *p = out + sprintf(out, "%0*llx  ", E.hex.offwidth, (unsigned long long)start);
+  int j;
+  for (j = 0; j < HEX_LINE_BYTES; j++) {
+    if (j == HEX_LINE_BYTES / 2) *p++ = ' ';  //extra gap between the two halves of a line
+    if (j < n) {
+      memcpy(p, &hexpairs[bytes[j] * 2], 2);
+    } else {  //last line of file can be short
+      p[0] = ' ';
+      p[1] = ' ';
+    }
+    p[2] = ' ';
+    p += 3;
+  }
+  *p++ = '|';
+  for (j = 0; j < n; j++)
+    *p++ = (bytes[j] >= 0x20 && bytes[j] < 0x7f) ? bytes[j] : '.';  //never send control bytes to the terminal
+  *p++ = '|';
+  return p - out;
+}
+
+int hexCursorCol() {  //screen column(0 based) of nibble under cursor
+  int j = E.hex.cur % HEX_LINE_BYTES;
+  return E.hex.offwidth + 2 + j * 3 + (j >= HEX_LINE_BYTES / 2) + E.hex.nibble;
+}
+
+void hexScroll() {
+  off_t line = E.hex.cur / HEX_LINE_BYTES;
+  if (line < E.hex.rowoff) {
+    E.hex.rowoff = line;
+  }
+  if (line >= E.hex.rowoff + E.screenrows) {
+    E.hex.rowoff = line - E.screenrows + 1;
+  }
+}
+
+void hexDrawRows(struct abuf *ab) {  //only the lines on screen are ever formatted
+  char line[128];
+  int y;
+  for (y = 0; y < E.screenrows; y++) {
+    off_t fileline = y + E.hex.rowoff;
+    if (fileline * HEX_LINE_BYTES >= E.hex.size) {
+      abAppend(ab, "~", 1);
+    } else {
+      int len = hexFormatLine(fileline, line);
+      if (len > E.screencols) len = E.screencols;
+      abAppend(ab, line, len);
+    }
+
+    abAppend(ab, "\x1b[K", 3);
+    abAppend(ab, "\r\n", 2);
+  }
+}
+
+int hexMatchAt(off_t at) {
+  int j;
+  for (j = 0; j < E.hex.patlen; j++)
+    if (hexByteAt(at + j) != E.hex.pat[j]) return 0;
+  return 1;
+}
+
+off_t hexSearch(off_t from) {  //offset of first match of E.hex.pat at or after from, -1 if none
+  off_t len = E.hex.patlen;
+  off_t best = -1;
+  //a match that covers an edited byte is only in the overlay, so try every start that overlaps an edit.
+  //edits are sorted, so the first one that gives a match gives the earliest such match
+  int i;
+  for (i = hexFindPatch(from); i < E.hex.numpatches && best == -1; i++) {
+    off_t s = E.hex.patch[i].off - len + 1;
+    if (s < from) s = from;
+    for (; s <= E.hex.patch[i].off && s + len <= E.hex.size; s++) {
+      if (hexMatchAt(s)) {
+        best = s;
+        break;
+      }
+    }
+  }
+  //every other match is the same in the file, let memmem() scan the map for it up to best
+  off_t at = from;
+  while (at + len <= E.hex.size) {
+    off_t end = (best == -1) ? E.hex.size : best + len - 1;
+    if (at + len > end) break;
+    unsigned char *m = memmem(&E.hex.map[at], end - at, E.hex.pat, len);
+    if (m == NULL) break;
+    if (hexMatchAt(m - E.hex.map)) {  //an edit may have broken this match
+      best = m - E.hex.map;
+      break;
+    }
+    at = m - E.hex.map + 1;
+  }
+  return best;
+}
+
+void hexFindFrom(off_t from) {  //jump to first match at or after from, wrapping to start of file
+  if (E.hex.patlen == 0) {
+    editorSetStatusMessage("No previous search");
+    return;
+  }
+  off_t at = hexSearch(from);
+  int wrapped = 0;
+  if (at == -1) {  //wrap around to start of file
+    at = hexSearch(0);
+    wrapped = 1;
+  }
+  if (at == -1) {
+    editorSetStatusMessage("Pattern not found");
+    return;
+  }
+  E.hex.cur = at;
+  E.hex.nibble = 0;
+  editorSetStatusMessage(wrapped ? "Found at 0x%llx (wrapped)" : "Found at 0x%llx", (unsigned long long)at);
+}
+
+void hexFind() {
+  char *query = editorPrompt("Search hex bytes or \"text: %s (ESC to cancel)");
+  if (query == NULL) return;
+
+  unsigned char pat[HEX_PAT_MAX];
+  int len = 0;
+  if (query[0] == '"') {  //literal text, closing quote is optional
+    char *text = &query[1];
+    len = strlen(text);
+    if (len > 0 && text[len - 1] == '"') len--;
+    if (len > HEX_PAT_MAX) len = -1;
+    else memcpy(pat, text, len);
+  } else {  //pairs of hex digits, spaces allowed anywhere
+    int digits = 0;
+    char *p;
+    for (p = query; *p; p++) {
+      if (*p == ' ') continue;
+      if (!isxdigit((unsigned char)*p) || (digits % 2 == 0 && len == HEX_PAT_MAX)) {
+        len = -1;
+        break;
+      }
+      int d = isdigit((unsigned char)*p) ? *p - '0' : tolower((unsigned char)*p) - 'a' + 10;
+      if (digits % 2 == 0) pat[len] = d << 4;
+      else pat[len++] |= d;
+      digits++;
+    }
+    if (digits % 2 != 0) len = -1;
+  }
+  free(query);
+
+  if (len <= 0) {
+    editorSetStatusMessage("Invalid pattern, give up to %d bytes as hex pairs or \"text", HEX_PAT_MAX);
+    return;
+  }
+  memcpy(E.hex.pat, pat, len);
+  E.hex.patlen = len;
+  hexFindFrom(E.hex.cur);  //new search can match right at cursor, e.g. magic bytes at offset 0
+}
+
+void hexGoto() {
+  char *query = editorPrompt("Go to offset: %s (ESC to cancel)");
+  if (query == NULL) return;
+
+  char *end;
+  errno = 0;
+  unsigned long long off = strtoull(query, &end, 0);  //base 0 takes 0x.. as hex, plain digits as decimal
+  if (errno != 0 || end == query || *end != '\0') {
+    editorSetStatusMessage("Invalid offset: %s", query);
+  } else if (off >= (unsigned long long)E.hex.size) {
+    editorSetStatusMessage("Offset past end of file (0x%llx bytes)", (unsigned long long)E.hex.size);
+  } else {
+    E.hex.cur = off;
+    E.hex.nibble = 0;
+  }
+  free(query);
+}
+
+void hexSave() {  //write only the edited bytes back in place, runs of adjacent edits go out in one pwrite()
+  if (E.hex.readonly) {
+    editorSetStatusMessage("Can't save! File was opened read-only");
+    return;
+  }
+
+  unsigned char buf[256];
+  int written = 0;
+  int i = 0;
+  while (i < E.hex.numpatches) {
+    off_t start = E.hex.patch[i].off;
+    int n = 0;
+    while (i < E.hex.numpatches && n < (int)sizeof(buf) && E.hex.patch[i].off == start + n)
+      buf[n++] = E.hex.patch[i++].byte;
+    if (pwrite(E.hex.fd, buf, n, start) != n) {
+      editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
+      return;
+    }
+    written += n;
+  }
+  free(E.hex.patch);  //map is shared, so it now shows the written bytes and overlay is not needed
+  E.hex.patch = NULL;
+  E.hex.numpatches = 0;
+  E.dirty = 0;
+  editorSetStatusMessage("%d bytes written to disk", written);
+}
+
+void hexProcessKey(int c) {
+  off_t page = (off_t)E.screenrows * HEX_LINE_BYTES;
+  switch (c) {
+    case CTRL_KEY('s'):
+      hexSave();
+      break;
+    case CTRL_KEY('g'):
+      hexGoto();
+      break;
+    case CTRL_KEY('f'):
+      hexFind();
+      break;
+    case CTRL_KEY('n'):
+      hexFindFrom(E.hex.cur + 1);
+      break;
+
+    case ARROW_LEFT:
+      if (E.hex.nibble) E.hex.nibble = 0;
+      else if (E.hex.cur > 0) E.hex.cur--;
+      break;
+    case ARROW_RIGHT:
+      if (E.hex.cur < E.hex.size - 1) E.hex.cur++;
+      E.hex.nibble = 0;
+      break;
+    case ARROW_UP:
+      if (E.hex.cur >= HEX_LINE_BYTES) E.hex.cur -= HEX_LINE_BYTES;
+      E.hex.nibble = 0;
+      break;
+    case ARROW_DOWN:
+      if (E.hex.cur + HEX_LINE_BYTES < E.hex.size) E.hex.cur += HEX_LINE_BYTES;
+      E.hex.nibble = 0;
+      break;
+    case PAGE_UP:
+      E.hex.cur = E.hex.cur >= page ? E.hex.cur - page : E.hex.cur % HEX_LINE_BYTES;
+      E.hex.nibble = 0;
+      break;
+    case PAGE_DOWN:
+      E.hex.cur = E.hex.cur + page < E.hex.size ? E.hex.cur + page : E.hex.size - 1;
+      E.hex.nibble = 0;
+      break;
+    case HOME_KEY:
+      E.hex.cur -= E.hex.cur % HEX_LINE_BYTES;
+      E.hex.nibble = 0;
+      break;
+    case END_KEY:
+      E.hex.cur += HEX_LINE_BYTES - 1 - E.hex.cur % HEX_LINE_BYTES;
+      if (E.hex.cur > E.hex.size - 1) E.hex.cur = E.hex.size - 1;
+      E.hex.nibble = 0;
+      break;
+
+    case BACKSPACE:
+    case CTRL_KEY('h'):
+    case DEL_KEY:   //undo edit of byte under cursor
+      if (!E.hex.readonly) hexSetByte(E.hex.cur, E.hex.map[E.hex.cur]);
+      break;
+
+    case CTRL_KEY('l'):
+    case '\x1b':
+      break;
+
+    default:
+      if (c >= 0 && c < 128 && isxdigit(c)) {  //overwrite nibble under cursor then step to the next one
+        if (E.hex.readonly) {
+          editorSetStatusMessage("File is read-only");
+          break;
+        }
+        int d = isdigit(c) ? c - '0' : tolower(c) - 'a' + 10;
+        unsigned char b = hexByteAt(E.hex.cur);
+        b = E.hex.nibble ? (b & 0xf0) | d : (b & 0x0f) | (d << 4);
+        hexSetByte(E.hex.cur, b);
+        if (E.hex.nibble == 0) {
+          E.hex.nibble = 1;
+        } else if (E.hex.cur < E.hex.size - 1) {
+          E.hex.cur++;
+          E.hex.nibble = 0;
+        }
+      }
+      break;
+  }
+}
+
 /*** output ***/
 
 void editorScroll() {
@@ -412,8 +1161,10 @@ void editorScroll() {
   if (E.cy < E.rowoff) {
     E.rowoff = E.cy;
   }
-  if (E.cy >= E.rowoff + E.screenrows) {
-    E.rowoff = E.cy - E.screenrows + 1;
+  if (E.cy - E.rowoff >= E.screenrows && editorScreenRowsBetween(E.rowoff, E.cy) >= E.screenrows) {  //count screen rows only when folds could matter
+    int times = E.screenrows - 1;
+    E.rowoff = E.cy;
+    while (times-- && E.rowoff > 0) E.rowoff = editorPrevVisibleRow(E.rowoff);
   }
   if (E.rx < E.coloff) {
     E.coloff = E.rx;
@@ -425,9 +1176,9 @@ void editorScroll() {
 
 void editorDrawRows(struct abuf *ab) {
   int y;
-  for (y = 0; y < E.screenrows; y++) {
-    int filerow = y + E.rowoff; //offset. y ranges from top to bottom of visible screen eg: in a 50*200 terminal y->{0...49}
-                                //On update of rowoff=1(from above function) filerow will now be =0+1=1. Therefore dispay on terminal will start from 2nd line of file. Basically scrolled one row down.
+  int filerow = E.rowoff; //offset. y ranges from top to bottom of visible screen eg: in a 50*200 terminal y->{0...49}
+                          //On update of rowoff=1(from above function) filerow will now be =0+1=1. Therefore dispay on terminal will start from 2nd line of file. Basically scrolled one row down.
+  for (y = 0; y < E.screenrows; y++, filerow = editorNextVisibleRow(filerow)) {
     if (filerow >= E.numrows) { //when current row greater than or equal to number of row in text file we start inserting '~' for the rest of the empty lines.
       if (E.numrows == 0 && y == E.screenrows / 3) {  //only when there is no file opened (and we are 1/3 of the way down) we display welcome text
         char welcome[80];
@@ -448,6 +1199,15 @@ void editorDrawRows(struct abuf *ab) {
       if (len < 0) len = 0;
       if (len > E.screencols) len = E.screencols;
       abAppend(ab, &E.row[filerow].render[E.coloff], len);
+      int f = editorFoldAt(filerow + 1);
+      if (f != -1 && E.fold[f].start == filerow + 1) {  //fold header, say how much is hidden
+        char marker[32];
+        int mlen = snprintf(marker, sizeof(marker), " [+%d lines]", E.fold[f].end - E.fold[f].start + 1);
+        if (mlen > E.screencols - len) mlen = E.screencols - len;
+        abAppend(ab, "\x1b[7m", 4);
+        abAppend(ab, marker, mlen);
+        abAppend(ab, "\x1b[m", 3);
+      }
     }
 
     abAppend(ab, "\x1b[K", 3);
@@ -458,8 +1218,14 @@ void editorDrawRows(struct abuf *ab) {
 void editorDrawStatusBar(struct abuf *ab) {
   abAppend(ab, "\x1b[7m", 4); //graphicRendition(m) command switches to inverted colors. 1-bold, 4-underscore, 5-blink, 7-invert
   char status[80], rstatus[80];
-  int len = snprintf(status, sizeof(status), "%.20s - %d lines %s", E.filename ? E.filename : "[No Name]", E.numrows, E.dirty ? "(modified)" : "");
-  int rlen = snprintf(rstatus, sizeof(rstatus), "%d/%d", E.cy + 1, E.numrows);  //current line no out of total lines
+  int len, rlen;
+  if (E.hex.map) {
+    len = snprintf(status, sizeof(status), "%.20s - %llu bytes [hex%s] %s", E.filename, (unsigned long long)E.hex.size, E.hex.readonly ? ", read-only" : "", E.dirty ? "(modified)" : "");
+    rlen = snprintf(rstatus, sizeof(rstatus), "0x%llx/0x%llx", (unsigned long long)E.hex.cur, (unsigned long long)E.hex.size);  //cursor offset out of file size
+  } else {
+    len = snprintf(status, sizeof(status), "%.20s - %d lines %s", E.filename ? E.filename : "[No Name]", E.numrows, E.dirty ? "(modified)" : "");
+    rlen = snprintf(rstatus, sizeof(rstatus), "%d/%d", E.cy + 1, E.numrows);  //current line no out of total lines
+  }
   if (len > E.screencols) len = E.screencols;
   abAppend(ab, status, len);
   while (len < E.screencols) {
@@ -484,18 +1250,23 @@ void editorDrawMessageBar(struct abuf *ab) {
 }
 
 void editorRefreshScreen() {
-  editorScroll();
+  if (E.hex.map) hexScroll();
+  else editorScroll();
   struct abuf ab = ABUF_INIT;
   abAppend(&ab, "\x1b[?25l", 6);    //resetMode(l) command to turn off features/modes. '?25l' cursor hiding
   //abAppend(&ab, "\x1b[2J", 4);    REMOVED and instead clear as we redraw on line at a time
   abAppend(&ab, "\x1b[H", 3);
 
-  editorDrawRows(&ab);
+  if (E.hex.map) hexDrawRows(&ab);
+  else editorDrawRows(&ab);
   editorDrawStatusBar(&ab);
   editorDrawMessageBar(&ab);
 
   char buf[32];
-  snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (E.cy-E.rowoff) + 1, (E.rx-E.coloff) + 1);    //Display cursor position. Updated!!!
+  if (E.hex.map)
+    snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (int)(E.hex.cur / HEX_LINE_BYTES - E.hex.rowoff) + 1, hexCursorCol() + 1);
+  else
+    snprintf(buf, sizeof(buf), "\x1b[%d;%dH", editorScreenRowsBetween(E.rowoff, E.cy) + 1, (E.rx-E.coloff) + 1);    //Display cursor position. Updated!!!
   abAppend(&ab, buf, strlen(buf));
 
   abAppend(&ab, "\x1b[?25h", 6);    //setMode(h) command to turn on. '?25h' cursor show. If hide/show feature not supported, ESC seq just ignored. No big deal
@@ -554,7 +1325,7 @@ void editorMoveCursor(int key) {
         E.cx--;
       }
       else if(E.cy > 0) {
-        E.cy--;
+        E.cy = editorPrevVisibleRow(E.cy);
         E.cx = E.row[E.cy].size;
       }
       break;
@@ -563,18 +1334,18 @@ void editorMoveCursor(int key) {
         E.cx++;
       }
       else if(row && E.cx == row->size) {
-        E.cy++;
+        E.cy = editorNextVisibleRow(E.cy);
         E.cx = 0;
       }
       break;
     case ARROW_UP:
       if (E.cy != 0) {                  //only if cursor is not at top of screen
-        E.cy--;
+        E.cy = editorPrevVisibleRow(E.cy);
       }
       break;
     case ARROW_DOWN:
       if (E.cy < E.numrows) {           //if cursor pos is smaller than the number of rows in text
-        E.cy++;
+        E.cy = editorNextVisibleRow(E.cy);
       }
       break;
   }
@@ -590,6 +1361,11 @@ void editorProcessKeypress() {  //get keypress from editorReadKey() and handles
   static int quit_times = KILO_QUIT_TIMES;
 
   int c = editorReadKey();
+  if (E.hex.map && c != CTRL_KEY('q')) {  //hex view has its own keys, only quitting is shared
+    hexProcessKey(c);
+    quit_times = KILO_QUIT_TIMES;
+    return;
+  }
   switch (c) {
     case '\r':
       editorInsertNewline();
@@ -610,6 +1386,13 @@ void editorProcessKeypress() {  //get keypress from editorReadKey() and handles
       editorSave();
       break;
 
+    case CTRL_KEY('b'):
+      editorMatchBracket();
+      break;
+    case CTRL_KEY('t'):
+      editorToggleFold();
+      break;
+
     case HOME_KEY:
       E.cx = 0;
       break;
@@ -621,7 +1404,16 @@ void editorProcessKeypress() {  //get keypress from editorReadKey() and handles
     case BACKSPACE:
     case CTRL_KEY('h'):
     case DEL_KEY:
-      if (c == DEL_KEY) editorMoveCursor(ARROW_RIGHT);
+      if (c == DEL_KEY) {
+        int f = editorFoldAt(E.cy + 1);
+        if (E.cy < E.numrows && E.cx == E.row[E.cy].size && f != -1 && E.fold[f].start == E.cy + 1) {  //at end of a fold header the next row in the file is hidden, show it and join that one
+          editorDelFold(f);
+          E.cy++;
+          E.cx = 0;
+        } else {
+          editorMoveCursor(ARROW_RIGHT);
+        }
+      }
       editorDelChar();
       break;
 
@@ -631,7 +1423,9 @@ void editorProcessKeypress() {  //get keypress from editorReadKey() and handles
         if (c == PAGE_UP) {
           E.cy = E.rowoff;
         } else if (c == PAGE_DOWN) {
-          E.cy = E.rowoff + E.screenrows - 1;
+          int times = E.screenrows - 1;
+          E.cy = E.rowoff;
+          while (times-- && E.cy < E.numrows) E.cy = editorNextVisibleRow(E.cy);  //last row on screen, folds skipped
           if (E.cy > E.numrows) E.cy = E.numrows;
         }
 
@@ -668,10 +1462,20 @@ void initEditor() { //func to init fields in struct E
   E.coloff = 0;   //beginning of line
   E.numrows = 0;  //temporary
   E.row = NULL;
+  E.tree = NULL;
+  E.treecap = 0;
+  E.fold = NULL;
+  E.numfolds = 0;
   E.dirty = 0;
   E.filename = NULL;
   E.statusmsg[0] = '\0';
   E.statusmsg_time = 0;
+  E.hex.map = NULL;
+  E.hex.fd = -1;
+  E.hex.force = 0;
+  E.hex.patch = NULL;
+  E.hex.numpatches = 0;
+  E.hex.patlen = 0;
 
   if (getWindowSize(&E.screenrows, &E.screencols) == -1) die("getWindowSize");
   E.screenrows -=2;
@@ -681,11 +1485,19 @@ void initEditor() { //func to init fields in struct E
 int main(int argc, char *argv[]) {
   enableRawMode();
   initEditor();
-  if (argc >= 2) {
-    editorOpen(argv[1]);  //open the file if arg provided else a blank file
+  int argi = 1;
+  if (argc >= 3 && strcmp(argv[1], "-x") == 0) {  //kethu -x <file> forces hex view
+    E.hex.force = 1;
+    argi = 2;
+  }
+  if (argc > argi) {
+    editorOpen(argv[argi]);  //open the file if arg provided else a blank file
   }
 
-  editorSetStatusMessage("HELP: Ctrl-S = save | Ctrl-Q = quit");
+  if (E.hex.map)
+    editorSetStatusMessage("HELP: Ctrl-S = save | Ctrl-Q = quit | Ctrl-G = goto | Ctrl-F/N = find/next");
+  else
+    editorSetStatusMessage("HELP: Ctrl-S = save | Ctrl-Q = quit | Ctrl-B = match bracket | Ctrl-T = fold");
 
   while (1) {
     editorRefreshScreen();      //renders screen